@@ -1,31 +1,67 @@
 #ifndef BUF_H
 #define BUF_H
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <vector>
 #include "db.h"
+#include "replace.h"
 // define if debug output wanted
 //#define DEBUGBUF
 
-// declarations for buffer pool hash table
-struct hashBucket
+// declarations for buffer pool hash table.  A (file,pageNo) pair is
+// packed into one 64-bit key: the file's id in the high half and the
+// page number in the low half.
+struct hashSlot
 {
-	File*	file;    // pointer a file object (more on this below)
-	int	pageNo;  // page number within a file
+	unsigned long long key;  // packed (file id, pageNo), EMPTYKEY if unused
 	int	frameNo; // frame number of page in the buffer pool
-	hashBucket* 	next;	 // next node in the hash table
 };
 
 
-// hash table to keep track of pages in the buffer pool
+// hash table to keep track of pages in the buffer pool.  It is split
+// into segments, each an open-addressing table with linear probing and
+// its own latch.  All slots are allocated up front from the number of
+// buffers, so insert, lookup and remove never call the allocator
+// (a segment only grows if it fills past 3/4, which a uniform hash
+// essentially never does).
 class BufHashTbl
 {
 private:
-    int HTSIZE;
-    hashBucket**  ht; // actual hash table
-    int	 hash(const File* file, const int pageNo); // returns value between 0 and HTSIZE-1
+    static const unsigned long long EMPTYKEY = ~0ULL;
+
+    struct alignas(64) Segment
+    {
+	hashSlot*  slots;   // 2^k slots
+	unsigned   mask;    // number of slots - 1
+	int        count;   // slots in use
+	std::mutex latch;   // protects this segment
+    };
+
+    int NUMSEGS;
+    int SEGSHIFT;        // 64 - log2(NUMSEGS)
+    Segment* segs;       // actual hash table
+
+    Segment & segment(unsigned long long h)
+    {
+	return segs[SEGSHIFT == 64 ? 0 : h >> SEGSHIFT];
+    }
+    void grow(Segment & seg);   // double the size of a full segment
 
 public:
-    BufHashTbl(const int htSize);  // constructor
+    static unsigned long long makeKey(const File* file, const int pageNo);
+    static unsigned long long hash(unsigned long long key); // 64-bit mix
+
+    BufHashTbl(const int numBufs);  // constructor
     ~BufHashTbl(); // destructor
+
+    // returns the latch protecting the segment of (file,pageNo).  The
+    // caller must hold it across insert, lookup and remove of that key.
+  std::mutex & latch(const File* file, const int pageNo);
 	
     // insert entry into hash table mapping (file,pageNo) to frameNo;
     // returns 0 if OK, HASHTBLERROR if an error occurred
@@ -42,19 +78,37 @@ public:
 };
 
 
+// one page of the residency manifest, see BufMgr::saveResidency()
+struct ResidentPage
+{
+	int pageNo;
+	int hotness;   // ReplPolicy::hotness() when it was saved
+};
+
+
 class BufMgr;  //forward declaration of BufMgr class 
 
-// class for maintaining information about buffer pool frames
+// class for maintaining information about buffer pool frames.
+// The fields are atomic so that the hit path can pin a frame under
+// its hash table latch only, without a global buffer pool lock.
 class BufDesc {
     friend class BufMgr;
 private:
-  File* file;   // pointer to file object
-  int   pageNo; // page within file
+  // pinCnt holds the number of user pins in its low bits.  While the
+  // buffer manager itself works on an unpinned frame (evicting it or
+  // flushing it) the CLAIMED bit is set instead, which keeps other
+  // threads from claiming the same frame but lets readers still pin it.
+  static const int CLAIMED = 1 << 30;
+  static const int PINMASK = CLAIMED - 1;
+
+  std::atomic<File*> file;   // pointer to file object
+  std::atomic<int>   pageNo; // page within file
   int	frameNo;  // frame # of frame
-  int   pinCnt; // number of times this page has been pinned
-  bool 	dirty;	  // true if dirty;  false otherwise
-  bool 	valid;   // true if page is valid
-  bool  refbit;	 // has this buffer frame been reference recently
+  std::atomic<int>   pinCnt; // number of times this page has been pinned
+  std::atomic<bool>  dirty;  // true if dirty;  false otherwise
+  std::atomic<bool>  valid;  // true if page is valid
+  std::atomic<bool>  ioPending; // page is still being read in from disk
+  std::atomic<bool>  prefetched; // read ahead and not referenced since
 
   void Clear() {  // initialize buffer frame for a new user
     	pinCnt = 0;
@@ -62,6 +116,8 @@ private:
 	pageNo = -1;
     	dirty = false;
 	valid = false;
+	ioPending = false;
+	prefetched = false;
   };
 
   void Set(File* filePtr, int pageNum) { 
@@ -70,64 +126,351 @@ private:
       pinCnt = 1;
       dirty = false;
       valid = true;
-      refbit = true;
+      prefetched = false;
   }
 
   BufDesc() {
       Clear();
   }
+
+public:
+  // could the frame be given to another page right now
+  bool evictable(const bool cleanOnly) const
+  {
+      return pinCnt == 0 && !(cleanOnly && dirty);
+  }
 };
 
 
-struct BufStats
+// A pinned page.  A handle is filled in by the BufMgr calls that take
+// one and unpins its page when it is released, reassigned or goes out
+// of scope.  It remembers the frame, so unlike unPinPage this needs no
+// hash table lookup (except for a page handed out from a file's
+// mapping, which has no frame).  Handles can be moved but not copied.
+class PageHandle
 {
-  int accesses;    // Total number of accesses to buffer pool
-  int diskreads;   // Number of pages read from disk (including allocs)
-  int diskwrites;  // Number of pages written back to disk
+    friend class BufMgr;
+public:
+    PageHandle() : mgr(NULL), pg(NULL), fl(NULL), pgNo(-1), frame(-1),
+                   dirty(false) {}
+    ~PageHandle() { release(); }
 
-  void clear()
+    PageHandle(PageHandle && other) : mgr(NULL) { take(other); }
+    PageHandle & operator=(PageHandle && other)
     {
-      accesses = diskreads = diskwrites = 0;
+	if (this != &other)
+	{
+	    release();
+	    take(other);
+	}
+	return *this;
     }
-      
-  BufStats()
+    PageHandle(const PageHandle &) = delete;
+    PageHandle & operator=(const PageHandle &) = delete;
+
+    bool   pinned() const { return mgr != NULL; }
+    Page*  page() const { return pg; }
+    Page*  operator->() const { return pg; }
+    File*  file() const { return fl; }
+    int    pageNo() const { return pgNo; }
+
+    // the page will be written back when it is replaced
+    void   markDirty() { dirty = true; }
+
+    // unpin the page now
+    inline void release();
+
+private:
+    BufMgr* mgr;    // NULL if no page is held
+    Page*   pg;
+    File*   fl;
+    int     pgNo;
+    int     frame;  // -1 for a page in a file's mapping
+    bool    dirty;
+
+    void take(PageHandle & other)
     {
-      clear();
+	mgr = other.mgr;
+	pg = other.pg;
+	fl = other.fl;
+	pgNo = other.pgNo;
+	frame = other.frame;
+	dirty = other.dirty;
+	other.mgr = NULL;
     }
 };
 
 
+// The buffer manager may be shared by any number of threads.  Each
+// (file,pageNo) is protected by one of the hash table latches and
+// frames are pinned with atomic operations, so no call takes a
+// pool-wide lock (the replacement policies other than clock have a
+// latch of their own, see replace.h).
+// flushFile() and disposePage() expect that no other thread is using
+// the pages of that file at the same time.
+//
+// When readPage sees a file being read in ascending page order, it
+// asks a background thread to read the next pages of the file into
+// clean or free frames, where they are left unpinned.  The window is
+// set with setReadAhead().
+//
+// A second background thread writes out dirty, unpinned pages in the
+// frames the replacement policy is about to give up, so that eviction
+// seldom has to write a page on the caller's time.  Its reach is set
+// with setBackgroundFlush().  All multi-page writes are sorted by file and
+// page number and adjacent pages go out in a single pwritev.
+//
+// The replacement policy is chosen when the pool is created: clock by
+// default, or 2Q, ARC or LRU-2, which resist being flushed out by
+// large scans.
+//
+// A page of a file opened with mapped reads (DB::setMappedReads) that
+// is not in the pool is handed out straight from the file's mapping,
+// pinned with a count kept by the file, and is not read ahead.  Once
+// it is unpinned dirty and no one else holds it, it is copied into a
+// frame, and from then on it is read and written back through the
+// pool like any other page.
+
 class BufMgr 
 {
 private:
-  unsigned int 	 clockHand;
   int   	 numBufs;    	// Number of pages in buffer pool
   BufHashTbl*    hashTable;  	// hash table mapping (File, page) to frame
   BufDesc*	 bufTable;  	// vector of status info, 1 per page
   BufStats	 bufStats;	// buffer pool statistics
+  ReplPolicy*    policy;        // picks the frames to replace
 
-  const Status allocBuf(int & frame);   // allocate a free frame.  
+  // allocate a free frame.  With cleanOnly, dirty pages are not
+  // considered and the search gives up if the policy finds none.
+  const Status allocBuf(int & frame, const bool cleanOnly = false);
   const void releaseBuf(int frame); // return unused frame to end of list
-  void advanceClock()
+
+  // pin (file,PageNo) if it is resident, waiting for a pending read
+  // to finish.  Returns false if the page is not in the buffer pool.
+  bool pinResident(File* file, const int PageNo, int & frame,
+                   bool & prefetchHit);
+
+  // the steps of pinResident and of bringing a page in: lookupPin pins
+  // a resident page without waiting for its read; installFrame maps
+  // (file,PageNo) to a frame from allocBuf and marks it ioPending, or
+  // if another thread got there first, releases that frame and pins
+  // the other copy instead (returning false); waitForRead waits for a
+  // pinned frame's read and checks that it succeeded; finishRead ends
+  // a read started after installFrame.
+  bool lookupPin(File* file, const int PageNo, int & frame,
+                 bool & prefetchHit);
+  bool installFrame(File* file, const int PageNo, int & frame,
+                    const bool prefetch = false);
+  bool waitForRead(File* file, const int PageNo, const int frame);
+  void finishRead(File* file, const int PageNo, const int frame,
+                  const Status status);
+
+  // bring (file,PageNo) in if needed and pin it; the work of readPage
+  const Status pinPage(File* file, const int PageNo, int & frame);
+  const Status pinNewPage(File* file, int & PageNo, int & frame); // allocPage
+
+  // readPage and unPinPage of a page in a file's mapping: pin the
+  // frame if the page is in the pool, the mapped page otherwise; the
+  // last dirty unpin of a mapped page moves it into a frame
+  const Status readMapped(File* file, const int PageNo, Page* mapped,
+                          Page*& page);
+  const Status unpinMapped(File* file, const int PageNo, const bool dirty);
+
+  // frame holding page, or -1 if it is a page of a file's mapping
+  int frameOf(const Page* page) const
+  {
+	return page >= bufPool && page < bufPool + numBufs ? page - bufPool : -1;
+  }
+
+  // give up a pin whose frame is known (PageHandle::release).
+  // disposePage clears a frame even while it is pinned, and the frame
+  // may then hold another page, so the pin is only given up here if the
+  // frame still holds the page and is pinned; otherwise unPinPage finds
+  // out what became of the page.
+  const Status unpinFrame(File* file, const int PageNo, const int frame,
+                          const bool dirty)
+  {
+	BufDesc* tmpbuf = &bufTable[frame];
+	int cnt = tmpbuf->pinCnt;
+	while (tmpbuf->file == file && tmpbuf->pageNo == PageNo
+	       && (cnt & BufDesc::PINMASK) > 0)
+	{
+	    // mark the frame dirty before giving up the pin, as unPinPage does
+	    if (dirty)
+		tmpbuf->dirty = true;
+	    if (tmpbuf->pinCnt.compare_exchange_weak(cnt, cnt - 1))
+		return OK;
+	}
+	return unPinPage(file, PageNo, dirty);
+  }
+
+  void setHandle(PageHandle & handle, File* file, const int PageNo,
+                 Page* page);
+
+  friend class PageHandle;
+
+  // read the pages of a run set up by readPages with one system call
+  const Status readRun(File* file, const int firstPageNo, const int count,
+                       Page** pages);
+
+  // access-pattern tracking for readahead, one entry per scan stream.
+  // A file's streams share a set of NUMSTREAMS entries (files hashing
+  // to the same set take each other's least recently used entries).
+  struct SeqTracker
+  {
+    std::atomic<const File*> file;
+    std::atomic<int> gen;         // bumped when the entry is taken over
+    std::atomic<int> lastPageNo;  // last page read or first hit after readahead
+    std::atomic<int> runLength;   // ascending accesses in a row
+    std::atomic<int> raNext;      // first page not yet requested
+    std::atomic<unsigned> used;   // raClock at the last access
+  };
+
+  struct RaRequest
+  {
+    File* file;
+    int   firstPageNo;
+    int   count;
+    SeqTracker* stream;           // the scan it reads ahead for
+    int   gen;                    // stream->gen when it was queued
+  };
+
+  static const int NUMTRACKERS = 256;
+  static const int NUMSTREAMS = 4;  // concurrent scans tracked per file
+  static const int SEQTRIGGER = 3;  // accesses in a row that make a scan
+  static const int MAXREADAHEAD = 256;
+  static const int MAXRAQUEUE = 64; // older requests are dropped
+
+  SeqTracker trackers[NUMTRACKERS];
+  std::atomic<unsigned> raClock; // counts accesses, for SeqTracker::used
+  int   raWindow;                // pages to keep read ahead, 0 = off
+  std::thread raThread;          // background readahead thread
+  std::mutex raLatch;            // protects raQueue, raActive, raStop
+  std::condition_variable raCond;  // signalled when work is queued
+  std::condition_variable raDone;  // signalled when a request is done
+  std::deque<RaRequest> raQueue; // readahead not yet started
+  const File* raActive;          // file the thread is reading now
+  bool  raStop;
+  std::atomic<int> bgPins;       // frames pinned by background work
+
+  // the first of the NUMSTREAMS trackers of file
+  SeqTracker* streams(const File* file)
   {
-	clockHand = (clockHand + 1) % numBufs;
+	return &trackers[((unsigned long)file >> 4)
+			 % (NUMTRACKERS / NUMSTREAMS) * NUMSTREAMS];
   }
+  SeqTracker & stream(File* file, const int PageNo, const int count,
+                      const int window, bool & started);
+  void noteAccess(File* file, const int PageNo,  // feed scan detection
+                  const int count = 1);
+  int  streamPosition(const RaRequest & req);    // scan's last page, or -1
+  void readAheadLoop();                          // body of raThread
+  void readAhead(const RaRequest & req);         // do one request
+  void cancelReadAhead(const File* file);        // drop and wait for file's
+
+  // read pages[0..count-1], which lie within MAXREADAHEAD pages of
+  // each other in page order, with one system call into scratch, and
+  // copy those not already in the pool into free or clean frames.  Sets
+  // full and stops when no clean frame is left.  Returns the number of
+  // pages brought in.
+  int  prewarmSpan(File* file, const ResidentPage* pages, const int count,
+                   Page* scratch, bool & full);
+
+  // residency manifest, see saveResidency()
+  typedef std::map<string, std::vector<ResidentPage> > Residency;
+
+  string    resManifest;         // written when the pool is deleted
+  Residency resFlushed;          // pages of files flushed since it was set
+  std::mutex resLatch;           // protects resFlushed
+
+  void collectResidency(Residency & res);  // the pages in the pool now
+
+  static const int FLUSHBATCH = 256;    // most frames written per batch
+  static const int FLUSHINTERVAL = 10;  // ms between flusher passes
+
+  std::atomic<double> flTarget;  // fraction of the pool next in line
+                                 // for replacement kept clean, 0 = no flusher
+  int*  flCandidates;            // flushAhead's list of those frames
+  std::thread flThread;          // background flusher thread
+  std::mutex flLatch;            // protects flStop
+  std::condition_variable flCond;  // wakes the flusher early
+  bool  flStop;
+
+  void flushLoop();              // body of flThread
+  void flushAhead();             // one pass of the flusher
+
+  // write the pages in frames[0..count-1] sorted by file and page
+  // number, coalescing adjacent pages into one write, and mark them
+  // clean; written is set to the pages that went out.  The caller must
+  // have claimed the frames.
+  const Status writeFrames(int* frames, const int count, int & written);
 
 
 public:
   Page*	         bufPool;   // actual buffer pool
 
-  BufMgr(const int bufs);
+  BufMgr(const int bufs, const ReplPolicyType replPolicy = REPL_CLOCK);
   ~BufMgr();
 
   const Status readPage(File* file, const int PageNo, Page*& page);
+
+  // pin the count consecutive pages starting at firstPageNo and return
+  // them in pages[0..count-1].  Runs of pages that are not in the pool
+  // are read with one system call each.  Each page must later be
+  // released with unPinPage.
+  const Status readPages(File* file, const int firstPageNo, const int count,
+                         Page** pages);
   const Status unPinPage(File* file, const int PageNo, const bool dirty);
   const Status allocPage(File* file, int& PageNo, Page*& page); 
                         // allocates a new, empty page 
+
+  // the same for PageHandles: the page is pinned in handle, whose
+  // previous page if any is released first, and is unpinned through
+  // it rather than with unPinPage
+  const Status readPage(File* file, const int PageNo, PageHandle & handle);
+  const Status readPages(File* file, const int firstPageNo, const int count,
+                         PageHandle* handles);
+  const Status allocPage(File* file, int& PageNo, PageHandle & handle);
+
+  // release handles[0..count-1]; ones holding no page are skipped
+  void  unpinAll(PageHandle* handles, const int count);
   const Status flushFile(const File* file); // writing out all dirty pages of the file
   const Status disposePage(File* file, const int PageNo); // dispose of page in file
   void  printSelf();
 
+  // print the pool's counters and latency percentiles as key=value
+  // lines with keys of the form buf.<counter>, for monitoring
+  void  exportStats(ostream & out) const;
+
+  // number of pages to read ahead of a sequential scan; 0 turns
+  // readahead off
+  void  setReadAhead(const int pages);
+
+  // fraction of the pool, counted in the order the replacement policy
+  // would give frames up, that the background flusher keeps clean;
+  // 0 stops the flusher
+  void  setBackgroundFlush(const double cleanFraction);
+
+  // Warm restart.  saveResidency writes a manifest of the pages in the
+  // pool: for each file, by name, the numbers of its resident pages
+  // (except read-ahead pages never used) with the policy's hotness hint
+  // for each.  After
+  // setResidencyManifest the pool also remembers the pages flushFile
+  // drops (as closing a file does), and saves the manifest there when
+  // it is deleted.  prewarm reads the pages a manifest lists for file
+  // into free frames, hottest first if they do not all fit, in page
+  // order with one read per run of consecutive pages; hot pages are
+  // then touched once, so the policy counts them as seen twice.
+  // Pages of a file's mapping are left to the mapping.
+  const Status saveResidency(const string & manifest);
+  void  setResidencyManifest(const string & manifest);
+  const Status prewarm(const string & manifest, File* file);
+
+  const char* policyName() const { return policy->name(); }
+
+  // number of frames holding a page
+  int   framesInUse() const;
+
   const BufStats & getBufStats() const // get buffer pool usage
   {
 	return bufStats;
@@ -138,5 +481,18 @@ public:
   }
 };
 
+
+inline void PageHandle::release()
+{
+    if (mgr)
+    {
+	if (frame >= 0)
+	    (void)mgr->unpinFrame(fl, pgNo, frame, dirty);
+	else
+	    mgr->unPinPage(fl, pgNo, dirty);
+	mgr = NULL;
+    }
+}
+
 #endif
 
@@ -0,0 +1,61 @@
+#ifndef BULKLOAD_H
+#define BULKLOAD_H
+
+#include "page.h"
+#include "db.h"
+
+// pages a BulkLoader stages before writing them out
+#define BULKRUNPAGES 256
+
+// Loads a stream of records into the pages of a new file without
+// going through the buffer pool.  Records are packed in order
+// into pages kept in a private staging buffer, each page chained to
+// the next with setNextPage, and every runPages pages are written with
+// a single File::writePages call.  finish() writes the last pages and
+// then the file header, once.
+//
+// The file must not have pages yet (FILENOTEMPTY): the loader cannot
+// chain its pages to ones the buffer pool may hold.  Nothing else may
+// allocate pages in the file while it is loaded (BADPAGENO), and the
+// new pages must not be read through the buffer pool before finish()
+// returns.  Records not written by finish() are lost when the loader
+// is deleted.
+
+class BulkLoader {
+ public:
+  BulkLoader(File* file, const int runPages = BULKRUNPAGES);
+  ~BulkLoader();
+
+  // add a record, returning its RID; NOSPACE if the record does not
+  // fit on an empty page
+  const Status insertRecord(const Record & rec, RID& rid);
+
+  // add recs[0..count-1] in order, returning their RIDs in rids;
+  // inserted is set to the number added, which is fewer than count
+  // only on an error (NOSPACE: recs[inserted] is too large)
+  const Status insertRecords(const Record* recs, const int count,
+                             RID* rids, int& inserted);
+
+  // write the staged pages and the file header.  Call it once, after
+  // the last record.
+  const Status finish();
+
+  int getFirstPage() const { return firstPageNo; }  // -1 if no records
+  int getNumPages() const { return numPages; }      // pages loaded
+  long long getNumRecords() const { return numRecords; }
+
+ private:
+  const Status newPage();     // start a page after the last one
+  const Status writeRun();    // write the staged pages
+
+  File* file;
+  int   runPages;             // pages the staging buffer holds
+  Page* run;                  // the staging buffer, DIRECTALIGN aligned
+  int   staged;               // pages in run; the last is being filled
+  int   runStart;             // page number of run[0], -1 until known
+  int   firstPageNo;          // first page loaded, the file's first page
+  int   numPages;
+  long long numRecords;
+};
+
+#endif
@@ -3,7 +3,10 @@
 
 #include <sys/types.h>
 #include <functional>
+#include <mutex>
+#include <atomic>
 #include "error.h"
+#include "stats.h"
 #include <string.h>
 using namespace std;
 
@@ -15,20 +18,78 @@ using namespace std;
 // forward class definition for db
 class DB;
 
+// structure of DB (header) page
+
+typedef struct {
+  int nextFree;                         // page # of next page on free list
+  int firstPage;                        // page # of first page in file
+  int numPages;                         // total # of pages in file
+  int pageSize;                         // PAGESIZE of the creating build,
+                                        // 0 in files from before it was kept
+} DBPage;
+
+// the file grows in multiples of this many pages
+#define EXTENTPAGES 64
+
+// alignment of page buffers handed to the kernel by a file opened with
+// O_DIRECT (a multiple of the logical block size of common devices)
+#define DIRECTALIGN 4096
+
+struct iovec;
+
 // class definition for open files
 class File {
   friend class DB;
   friend class OpenFileHashTbl;
+  friend class BufHashTbl;
+  friend class BufMgr;
 
  public:
 
   Status allocatePage(int& pageNo);     // allocate a new page
+
+  // allocate count new consecutive pages at the end of the file; the
+  // first one is returned in firstPageNo.  The free list is not used.
+  const Status allocatePages(const int count, int& firstPageNo);
+
+  // the same, but only if the new pages start at firstPageNo; returns
+  // BADPAGENO, with the file unchanged, if the file does not end there
+  const Status allocatePagesAt(const int firstPageNo, const int count);
   const Status disposePage(const int pageNo);       // release space for a page
   const Status readPage(const int pageNo,
 		  Page* pagePtr) const;       // read page from file
   const Status writePage(const int pageNo,
 		   const Page* pagePtr);      // write page to file
+
+  // read/write count consecutive pages starting at firstPageNo with a
+  // single system call, to/from one contiguous array of pages or to/from
+  // count separate page buffers
+  const Status readPages(const int firstPageNo, const int count,
+		   Page* pages) const;
+  const Status readPages(const int firstPageNo, const int count,
+		   Page* const* pagePtrs) const;
+  const Status writePages(const int firstPageNo, const int count,
+		   const Page* pages);
+  const Status writePages(const int firstPageNo, const int count,
+		   const Page* const* pagePtrs);
   const Status getFirstPage(int& pageNo) const;     // returns pageNo of first page
+  const Status getNumPages(int& numPages) const;    // returns # of pages,
+                                                    // header page included
+
+  // write the header back to page 0 if it changed since it was read
+  // or last written.  Called by close() and BufMgr::flushFile().
+  const Status flushHeader() const;
+
+  // true if reads and writes bypass the OS page cache (O_DIRECT)
+  bool usingDirectIO() const { return direct; }
+
+  // true if the file was mapped with mmap when it was opened, see
+  // DB::setMappedReads
+  bool usingMappedReads() const { return mapBase != NULL; }
+
+  // buffer pool and system call counters for this file
+  const FileStats & getStats() const { return stats; }
+  void clearStats() { stats.clear(); }
 
   bool operator == (const File & other) const
     {
@@ -43,13 +104,37 @@ class File {
   static const Status create(const string &fileName);
   static const Status destroy(const string &fileName);
 
-  const Status open();
+  const Status open(const bool directIO = false, const bool mapped = false);
   const Status close();
 
+  // map the pages the file holds when opened, and unmap them again
+  void map();
+  void unmap();
+
+  // page pageNo in the mapping, or NULL if it is not mapped (the
+  // header page never is)
+  Page* mappedPage(const int pageNo) const
+    {
+      return pageNo > 0 && pageNo < mapPages ? mapBase + pageNo : NULL;
+    }
+
+  // pread, pwrite, preadv and pwritev, falling back to the page cache
+  // when O_DIRECT rejects a transfer
+  ssize_t ioRead(void* buf, const size_t len, const off_t off) const;
+  ssize_t ioWrite(const void* buf, const size_t len, const off_t off) const;
+  ssize_t ioReadv(const struct iovec* iov, const int n, const off_t off) const;
+  ssize_t ioWritev(const struct iovec* iov, const int n, const off_t off) const;
+  bool    dropDirect() const;
+
   const Status intread(const int pageNo,
 		 Page* pagePtr) const;        // internal file read
   const Status intwrite(const int pageNo,
 		  const Page* pagePtr);       // internal file write
+  const Status intreadv(const int firstPageNo, const int count,
+		  Page* const* pagePtrs) const;        // internal vectored read
+  const Status intwritev(const int firstPageNo, const int count,
+		  const Page* const* pagePtrs);        // internal vectored write
+  const Status extend(const int numPages);     // make room for numPages
 
 #ifdef DEBUGFREE
   void listFree();                      // list free pages
@@ -58,6 +143,26 @@ class File {
   string fileName;                    // The name of the file
   int openCnt;                        // # times file has been opened
   int unixFile;                       // unix file stream for file
+  int fileId;                         // unique id, used in buffer pool keys
+  mutable std::mutex latch;           // protects header, headerDirty
+                                      // and extentPages
+  mutable DBPage header;              // copy of page 0 while open
+  mutable bool headerDirty;           // header not yet written back
+  int extentPages;                    // pages the unix file has room for
+  bool openedDirect;                  // opened with O_DIRECT
+  mutable std::atomic<bool> direct;   // O_DIRECT still in effect
+  mutable FileStats stats;            // kept by File and BufMgr
+
+  // Pages handed out by BufMgr straight from the mapping are counted
+  // here, one entry per mapped page: the number of pins in the low
+  // bits, and MAPDIRTY once a pin was given up dirty while others held
+  // the page.  Both are kept under the page's buffer hash table latch.
+  static const int MAPDIRTY = 1 << 30;
+  static const int MAPPINMASK = MAPDIRTY - 1;
+
+  Page* mapBase;                      // the file mapped with mmap, or NULL
+  int mapPages;                       // pages in the mapping
+  std::atomic<int>* mapPins;          // pins of each mapped page
 };
 
 class BufMgr;
@@ -94,6 +199,9 @@ public:
 
     // returns OK if fileName was found.  Else return HASHTBLERROR
     Status erase(const string fileName);
+
+    // call fn for every open file
+    void forEach(const std::function<void(File*)> & fn) const;
 };
 
 
@@ -107,19 +215,32 @@ class DB {
   const Status destroyFile(const string & fileName) ; // destroy a file, 
                                                            // release all space
   const Status openFile(const string & fileName, File* & file);  // open a file
-  const Status closeFile(File* file);         // close a file
+  const Status closeFile(File* file);         // close a file; PAGEPINNED,
+                                              // leaving it open, while
+                                              // any of its pages is pinned
+
+  // open files from now on with O_DIRECT, so pages are cached only in
+  // the buffer pool.  Files whose file system refuses O_DIRECT, or
+  // that are handed unaligned buffers, quietly use the page cache.
+  void setDirectIO(const bool on) { directIO = on; }
+
+  // map files opened from now on with mmap.  BufMgr then hands out
+  // clean pages straight from the mapping, with no copy into the
+  // buffer pool, and moves a page into the pool when it is first
+  // unpinned dirty.  Only the pages a file holds when it is opened are
+  // mapped; later ones go through the pool as usual.  A mapped file
+  // uses the page cache even if setDirectIO is on.
+  void setMappedReads(const bool on) { mappedReads = on; }
+
+  // print the counters of every open file as key=value lines, with
+  // keys of the form file.<name>.<counter>
+  void exportStats(ostream & out) const;
 
  private:
   OpenFileHashTbl   openFiles;    // list of open files
+  bool              directIO;     // open files with O_DIRECT
+  bool              mappedReads;  // map files with mmap
 };
 
 
-// structure of DB (header) page
-
-typedef struct {
-  int nextFree;                         // page # of next page on free list
-  int firstPage;                        // page # of first page in file
-  int numPages;                         // total # of pages in file
-} DBPage;
-
 #endif
@@ -17,12 +17,13 @@ enum Status {
 // File and DB errors
 
        BADFILEPTR, BADFILE, FILETABFULL, FILEOPEN, FILENOTOPEN,
-       UNIXERR, BADPAGEPTR, BADPAGENO, FILEEXISTS,
+       UNIXERR, BADPAGEPTR, BADPAGENO, FILEEXISTS, BADPAGESIZE,
+       FILENOTEMPTY,
 
 // BufMgr and HashTable errors
 
        HASHTBLERROR, HASHNOTFOUND, BUFFEREXCEEDED, PAGENOTPINNED,
-       BADBUFFER, PAGEPINNED,
+       BADBUFFER, PAGEPINNED, BADMANIFEST,
 
 // Page errors
 	
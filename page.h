@@ -17,48 +17,120 @@ struct Record
   int length;
 };
 
+// The page size is fixed at build time (make PAGESIZE=8192); a power
+// of two from 1K to 64K.  Every file records the page size it was
+// created with and cannot be opened by a build with another one.
+#ifndef MINIREL_PAGESIZE
+#define MINIREL_PAGESIZE 1024
+#endif
+
+#if MINIREL_PAGESIZE < 1024 || MINIREL_PAGESIZE > 65536 \
+    || (MINIREL_PAGESIZE & (MINIREL_PAGESIZE - 1)) != 0
+#error "MINIREL_PAGESIZE must be a power of two from 1024 to 65536"
+#endif
+
+// offsets and sizes within a page; short only reaches 32K
+#if MINIREL_PAGESIZE > 32768
+typedef int pgoff_t;
+#else
+typedef short pgoff_t;
+#endif
+
 // slot structure
 struct slot_t {
-        short	offset;  
-        short	length;  // equals -1 if slot is not in use
+        pgoff_t	offset;  // of the record; in an unused slot, the next
+                         // unused slot on the free-slot list (see Page)
+        pgoff_t	length;  // equals -1 if slot is not in use
 };
 
-const unsigned PAGESIZE = 1024;
-const unsigned DPFIXED= sizeof(slot_t)+4*sizeof(short)+2*sizeof(int);
+// one record found by Page::getRecords
+struct SlotEntry
+{
+  int slotNo;   // slot number, as in a RID
+  int offset;   // of the record, see Page::recordAt
+  int length;
+};
+
+const unsigned PAGESIZE = MINIREL_PAGESIZE;
+const unsigned DPFIXED= sizeof(slot_t)+4*sizeof(pgoff_t)+2*sizeof(int);
 const unsigned PAGEDATASIZE = PAGESIZE-DPFIXED+sizeof(slot_t);
 // size of the data area of a page
+const int SLOTOFFSET = PAGESIZE-DPFIXED;
+// offset of slot[0] within a page, just past data[]
 
 // Class definition for a minirel data page.   
-// The design assumes that records are kept compacted when
-// deletions are performed. Notice, however, that the slot
-// array cannot be compacted.  Notice, this class does not keep
-// the records align, relying instead on upper levels to take
-// care of non-aligned attributes
+// By default records are kept compacted when deletions are
+// performed.  A lazy delete (the lazy argument of deleteRecord and
+// deleteRecords) only frees the record's slot and leaves a hole, and
+// the page is compacted when an insert needs more contiguous space
+// than there is; a pointer from getRecord survives lazy deletes of
+// other records, up to the next insert.  A page can take both kinds of
+// delete in any mix, and the choice is the caller's, made per call, so
+// callers sharing a page must agree on it.  Notice, however, that the
+// slot array cannot be compacted.
+// Unused slots in the middle of the array are chained into a list
+// headed by freeSlot, so inserts reuse them without a search.
+// Notice, this class does not keep the records align, relying
+// instead on upper levels to take care of non-aligned attributes
 
 class Page {
 private:
     char 	data[PAGESIZE - DPFIXED]; 
     slot_t 	slot[1]; // first element of slot array - grows backwards!
-    short	slotCnt; // number of slots in use;
-    short	freePtr; // offset of first free byte in data[]
-    short	freeSpace; // number of bytes free in data[]
-    short	dummy;	// for alignment purposes
+    pgoff_t	slotCnt; // number of slots in use;
+    pgoff_t	freePtr; // offset of first free byte in data[]
+    pgoff_t	freeSpace; // number of bytes free in data[]
+    pgoff_t	freeSlot; // 1 + slot # of the first unused slot, 0 if none;
+                          // only a hint, since pages written before it
+                          // existed hold garbage here
     int		nextPage; // forwards pointer
     int		curPage;  // page number of current pointer
 
+    // The slot array grows backwards from slot[0] into data[], so it is
+    // indexed with numbers <= 0.  Indexing slot, or a pointer to it,
+    // with those goes outside the one-element array, which is undefined
+    // (optimizing compilers assume the index is 0).  The address of slot
+    // i is worked out from the bytes of the page instead.
+    slot_t & slotAt(const int i)
+      { return *(slot_t*)((char*)this + SLOTOFFSET + i * (int)sizeof(slot_t)); }
+    const slot_t & slotAt(const int i) const
+      { return *(const slot_t*)((const char*)this + SLOTOFFSET
+                                + i * (int)sizeof(slot_t)); }
+
+    int  contiguousSpace() const;   // free bytes after freePtr
+    void compact();                 // close the holes left by deletes
+    int  findFreeSlot();            // head of the free-slot list, or slotCnt
+    void rebuildFreeSlots();        // rechain all unused slots
+    void releaseSlot(const int slotNo);  // delete without moving records
+    bool validSlot(const int slotNo) const;  // slot holds a record
+
 public:
     void init(const int pageNo); // initialize a new page
     void dumpPage() const;       // dump contents of a page
 
     const Status getNextPage(int& pageNo) const; // returns value of nextPage
     const Status setNextPage(const int pageNo); // sets value of nextPage to pageNo
-    const short getFreeSpace() const; // returns amount of free space
+    const pgoff_t getFreeSpace() const; // returns amount of free space
 
     // inserts a new record (rec) into the page, returns RID of record 
     const Status insertRecord(const Record & rec, RID& rid);
 
-    // delete the record with the specified rid
-    const Status deleteRecord(const RID & rid);
+    // delete the record with the specified rid; lazily (see above) if
+    // lazy is set
+    const Status deleteRecord(const RID & rid, const bool lazy = false);
+
+    // insert recs[0..count-1] in order, returning their RIDs in rids,
+    // until one does not fit; inserted is set to the number inserted.
+    // Returns NOSPACE if that is fewer than count.  The page is
+    // compacted at most once.
+    const Status insertRecords(const Record* recs, const int count,
+                               RID* rids, int& inserted);
+
+    // delete the records rids[0..count-1], stopping at the first invalid
+    // one (INVALIDSLOTNO).  Unless lazy is set the page is compacted
+    // once at the end instead of once per record.
+    const Status deleteRecords(const RID* rids, const int count,
+                               const bool lazy = false);
 
     // returns RID of first record on page
     // returns  NORECORDS if page contains no records.  Otherwise, returns OK
@@ -70,6 +142,20 @@ public:
 
     // returns reference to record with RID rid
     const Status getRecord(const RID & rid, Record & rec);
+
+    // Batch iteration: fills entries[0..count-1] with up to max records,
+    // looking at the slots from nextSlot (0 to start) on, and advances
+    // nextSlot past the slots looked at.  Returns ENDOFPAGE, with count
+    // 0, when no records are left.  Entries stay valid until the page
+    // is changed.
+    const Status getRecords(int& nextSlot, SlotEntry* entries, const int max,
+                            int& count) const;
+
+    // the record at an offset returned by getRecords
+    char* recordAt(const int offset) { return &data[offset]; }
+    const char* recordAt(const int offset) const { return &data[offset]; }
 };
 
+static_assert(sizeof(Page) == PAGESIZE, "Page must fill PAGESIZE bytes");
+
 #endif
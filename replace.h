@@ -0,0 +1,110 @@
+#ifndef REPLACE_H
+#define REPLACE_H
+
+#include <atomic>
+#include <mutex>
+
+// Page replacement policies for the buffer manager.  A policy only
+// decides which frame to give up next; the buffer manager still owns
+// the frames, the hash table and the pin counts.  Each policy keeps its
+// bookkeeping in arrays indexed by frame number (and, for the policies
+// that remember recently evicted pages, in a fixed-size ghost table of
+// page keys), not in BufDesc.
+//
+// A page key is the packed (file id, pageNo) value that the buffer
+// pool hash table uses, see BufHashTbl::makeKey().
+//
+// All methods may be called from several threads at once.
+
+class BufDesc;
+
+enum ReplPolicyType
+{
+  REPL_CLOCK,   // clock (second chance), the default
+  REPL_2Q,      // 2Q (Johnson & Shasha, VLDB '94)
+  REPL_ARC,     // adaptive replacement cache (Megiddo & Modha, FAST '03)
+  REPL_LRU2     // LRU-K with K=2 (O'Neil, O'Neil & Weikum, SIGMOD '93)
+};
+
+class ReplPolicy
+{
+public:
+  virtual ~ReplPolicy() {}
+
+  // create a policy of the given type for a pool of numBufs frames
+  static ReplPolicy* create(const ReplPolicyType type, const int numBufs);
+
+  virtual const char* name() const = 0;
+
+  // a page with the given key was brought into frame
+  virtual void installed(const int frame, const unsigned long long key) = 0;
+
+  // the page in frame was accessed again
+  virtual void accessed(const int frame) = 0;
+
+  // the page in frame was replaced after victim() proposed the frame
+  virtual void evicted(const int frame) = 0;
+
+  // the page in frame was dropped for another reason (file flushed,
+  // page disposed of, read failed); it is not remembered
+  virtual void removed(const int frame) = 0;
+
+  // propose a frame to replace.  Only frames that are evictable at the
+  // time of the call are proposed; the buffer manager still has to
+  // claim the frame and may call again if that fails.  Apart from the
+  // clock's reference bits, the policy's state does not change until
+  // evicted() is called.  With cleanOnly,
+  // frames holding dirty pages are not proposed.  Returns -1 if no
+  // frame can be replaced.
+  virtual int  victim(const BufDesc* bufTable, const bool cleanOnly) = 0;
+
+  // fill frames[] with up to max frames in roughly the order the policy
+  // would replace them, pinned or not; used by the background flusher
+  virtual int  candidates(int* frames, const int max) = 0;
+
+  // how much the policy wants to keep the page in frame: 0 if it is
+  // among the pages given up first (seen only once, or not referenced
+  // since the clock hand last passed it), 1 otherwise.  Saved with the
+  // residency manifest, see BufMgr::saveResidency().
+  virtual int  hotness(const int frame) = 0;
+};
+
+
+// Set of recently evicted page keys in FIFO order, with room for a
+// fixed number of keys and a small value per key.  Used for the ghost
+// lists of 2Q and ARC and the retained history of LRU-2.  Not thread
+// safe; the policies call it under their own latch.
+
+class GhostList
+{
+public:
+  GhostList(const int capacity);
+  ~GhostList();
+
+  bool contains(const unsigned long long key, unsigned long long & value);
+  void remove(const unsigned long long key);
+  void push(const unsigned long long key, const unsigned long long value);
+  void popOldest();
+  int  size() const { return count; }
+
+private:
+  static const unsigned long long EMPTYKEY = ~0ULL;
+
+  int find(const unsigned long long key) const;  // map slot, or -1
+  void unmap(const unsigned long long key);
+
+  unsigned long long* ring;    // keys in insertion order, EMPTYKEY holes
+  unsigned long long* values;  // value of ring[i]
+  int   maxCount;              // capacity
+  int   ringSize;              // 2 * capacity, leaving room for holes
+  int   head;                  // next ring slot to fill
+  int   tail;                  // oldest ring slot
+  int   used;                  // ring slots from tail to head
+  int   count;                 // keys in the list
+
+  unsigned long long* mapKeys; // open-addressing map key -> ring slot
+  int*  mapPos;
+  unsigned mapMask;
+};
+
+#endif
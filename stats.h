@@ -0,0 +1,194 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+using namespace std;
+
+// Instrumentation for the buffer manager and the files under it.  All
+// counters are 64 bits and may be bumped from any thread.  They can be
+// read at any time; a reading taken while other threads are working
+// is not an atomic snapshot across counters.
+
+
+// A 64-bit event counter split into cache-line sized stripes.  Each
+// thread adds to its own stripe, so counters bumped on every page
+// access do not bounce one cache line between cores; reading sums the
+// stripes.
+class StatCounter
+{
+public:
+  StatCounter() { clear(); }
+
+  void add(const long long n = 1)
+    {
+      cells[stripe()].v.fetch_add(n, std::memory_order_relaxed);
+    }
+  void operator++(int) { add(1); }
+  void operator+=(const long long n) { add(n); }
+
+  long long value() const
+    {
+      long long sum = 0;
+      for (int i = 0; i < STRIPES; i++)
+        sum += cells[i].v.load(std::memory_order_relaxed);
+      return sum;
+    }
+  operator long long() const { return value(); }
+
+  void clear()
+    {
+      for (int i = 0; i < STRIPES; i++)
+        cells[i].v = 0;
+    }
+
+private:
+  static const int STRIPES = 16;
+
+  struct alignas(64) Cell
+  {
+    std::atomic<long long> v;
+  };
+  Cell cells[STRIPES];
+
+  static std::atomic<int> nextStripe;
+  static int stripe()
+    {
+      static thread_local int s = nextStripe.fetch_add(1) % STRIPES;
+      return s;
+    }
+};
+
+
+// Latency histogram with power-of-two buckets: bucket b counts times
+// in [2^(b-1), 2^b) nanoseconds, bucket 0 times under 1 ns, and the
+// last bucket everything from about 9 minutes up.  Percentiles are
+// reported as the upper bound of their bucket, so they are within a
+// factor of two.
+//
+// Reading the clock costs about as much as a buffer pool hit, so
+// calls that are mostly hits time only every SAMPLEPERIOD-th call of
+// each thread (see sample()); count() is then the number of samples.
+class LatencyHistogram
+{
+public:
+  static const int BUCKETS = 40;
+  static const int SAMPLEPERIOD = 64;
+
+  LatencyHistogram() { clear(); }
+
+  void record(const long long ns)
+    {
+      int b = ns <= 0 ? 0 : 64 - __builtin_clzll((unsigned long long)ns);
+      if (b >= BUCKETS)
+        b = BUCKETS - 1;
+      buckets[b].fetch_add(1, std::memory_order_relaxed);
+    }
+
+  long long count() const;
+  long long percentile(const double p) const;  // p in [0,1], in ns
+  long long bucket(const int b) const { return buckets[b]; }
+  void clear();
+
+  // print prefix.count, .p50_ns, .p99_ns, .p999_ns and .max_ns lines
+  void exportTo(ostream & out, const string & prefix) const;
+
+  // true on every SAMPLEPERIOD-th call from a thread
+  static bool sample()
+    {
+      static thread_local unsigned n = 0;
+      return ++n % SAMPLEPERIOD == 0;
+    }
+
+  // monotonic clock in ns
+  static long long now()
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+private:
+  std::atomic<long long> buckets[BUCKETS];
+};
+
+
+// Records the time from its construction to its destruction in a
+// histogram, or nothing if given none.
+class LatencyTimer
+{
+public:
+  LatencyTimer(LatencyHistogram* h)
+    : hist(h), start(h ? LatencyHistogram::now() : 0) {}
+  ~LatencyTimer()
+    {
+      if (hist)
+        hist->record(LatencyHistogram::now() - start);
+    }
+
+private:
+  LatencyHistogram* hist;
+  long long start;
+};
+
+
+// buffer pool counters, for the whole pool
+
+struct BufStats
+{
+  StatCounter accesses;     // Total number of accesses to buffer pool
+  StatCounter hits;         // Reads of pages already in the pool
+  StatCounter misses;       // Reads that had to go to disk
+  StatCounter diskreads;    // Number of pages read from disk (including allocs)
+  StatCounter diskwrites;   // Number of pages written back to disk
+  StatCounter evictions;    // Pages replaced to make room for another
+  StatCounter dirtyEvictions; // ... of which were written out first
+  StatCounter pinWaits;     // Pins that waited for another thread's read
+  StatCounter bufExceeded;  // allocBuf failures with BUFFEREXCEEDED
+  StatCounter raPages;      // Number of pages read ahead (also in diskreads)
+  StatCounter raHits;       // Read-ahead pages that were then accessed
+  StatCounter raWasted;     // Read-ahead pages evicted without an access
+  StatCounter flushWrites;  // Pages written by the background flusher
+  StatCounter flushErrors;  // ... and pages it failed to write
+  StatCounter mappedReads;  // Reads served from a file's mapping (not
+                            // counted as hits or misses)
+  StatCounter mapCopies;    // Mapped pages moved into the pool when dirtied
+  StatCounter prewarmPages; // Pages read by prewarm (also in diskreads)
+
+  LatencyHistogram readPageLatency;   // sampled
+  LatencyHistogram allocPageLatency;  // sampled
+
+  void clear();
+
+  // print one key=value line per counter, each key starting with prefix
+  void exportTo(ostream & out, const string & prefix) const;
+};
+
+
+// counters for one open file: its share of the buffer pool activity
+// and the system calls made for it
+
+struct FileStats
+{
+  StatCounter hits;         // buffer pool reads of the file's pages
+  StatCounter misses;
+  StatCounter evictions;
+  StatCounter dirtyEvictions;
+  StatCounter mappedReads;
+
+  StatCounter readCalls;    // pread, preadv
+  StatCounter writeCalls;   // pwrite, pwritev
+  StatCounter otherCalls;   // fallocate, ftruncate, fcntl, mmap, munmap
+  StatCounter pagesRead;
+  StatCounter pagesWritten;
+
+  LatencyHistogram readLatency;   // each page read, single or vectored
+  LatencyHistogram writeLatency;  // each page write, single or vectored
+
+  void clear();
+  void exportTo(ostream & out, const string & prefix) const;
+};
+
+#endif